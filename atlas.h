@@ -3,10 +3,26 @@
 #ifdef __cplusplus
 #include <chrono>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <new>
+#include <exception>
+#include <cstddef>
 #include <pthread.h>
 #include <algorithm>
 #include <sstream>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define ATLAS_HAVE_COROUTINES 1
+#elif defined(__cpp_coroutines) && __has_include(<experimental/coroutine>)
+#include <experimental/coroutine>
+#define ATLAS_HAVE_COROUTINES 1
+#endif
 
 #include <cerrno>
 #else
@@ -278,6 +294,356 @@ decltype(auto) update(const Handle &tid, uint64_t id,
   return atlas::update(from(tid), id, nullptr, &tv_deadline);
 }
 }
+
+#ifdef ATLAS_HAVE_COROUTINES
+namespace detail {
+#if defined(__cpp_impl_coroutine)
+namespace coro = std;
+#else
+namespace coro = std::experimental;
+#endif
+}
+#endif
+
+class executor;
+
+/* Completion handle for a job submitted through an atlas::executor. Instead
+ * of executor::submit() returning a handle, the caller owns the job and passes
+ * it in: the job must stay alive and in place until it is ready(), since the
+ * executor and any awaiting coroutines refer to it by address. It can neither
+ * be copied nor moved. In exchange neither submission nor completion
+ * allocates.
+ *
+ * A job optionally carries a body, which the consumer runs when atlas::next()
+ * returns the job's id. Without a body the job completes as soon as the
+ * consumer has been handed its id. Producers either block in wait() or, with
+ * coroutine support, co_await the job; any number of coroutines may await the
+ * same job and are resumed on the consumer thread, in the order they
+ * suspended, right after the job completed.
+ *
+ * A job withdrawn through executor::remove() completes as cancelled: its body
+ * is not run, waiters are released and resumed on the thread calling remove(),
+ * and cancelled() returns true. The same holds for a job whose body threw,
+ * except that waiters are resumed on the consumer thread.
+ */
+class job {
+  friend class executor;
+
+  const uint64_t id_;
+  void (*body_)(void *) = nullptr;
+  void *context_ = nullptr;
+  job *next_ = nullptr;
+  /* set once the job is handed to an executor, cleared only if that fails */
+  std::atomic_bool submitted_{false};
+
+  /* nullptr: pending, this: completed, anything else: most recently
+   * suspended awaiter, which links to the ones before it. */
+  std::atomic<void *> state_{nullptr};
+  bool cancelled_ = false;
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+
+  bool completed() const noexcept { return state_.load() == this; }
+
+  void complete(const bool cancelled = false) {
+    void *waiters;
+    {
+      /* Waiters may destroy the job as soon as they observe completion, so
+       * it is published and signalled while holding the lock. */
+      std::lock_guard<std::mutex> lock(mutex_);
+      cancelled_ = cancelled;
+      waiters = state_.exchange(this);
+      cv_.notify_all();
+    }
+#ifdef ATLAS_HAVE_COROUTINES
+    awaiter::resume_all(waiters == this ? nullptr
+                                        : static_cast<awaiter *>(waiters));
+#else
+    static_cast<void>(waiters);
+#endif
+  }
+
+protected:
+  job(const uint64_t id, void (*body)(void *), void *context) noexcept
+      : id_(id), body_(body), context_(context) {}
+
+public:
+  explicit job(const uint64_t id) noexcept : id_(id) {}
+  job(const job &) = delete;
+  job &operator=(const job &) = delete;
+
+  uint64_t id() const noexcept { return id_; }
+  bool ready() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return completed();
+  }
+
+  bool cancelled() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cancelled_;
+  }
+
+  void wait() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return completed(); });
+  }
+
+#ifdef ATLAS_HAVE_COROUTINES
+  /* Lives in the frame of the suspended coroutine and doubles as the node of
+   * the job's waiter list. */
+  class awaiter {
+    friend class job;
+
+    job &job_;
+    awaiter *next_ = nullptr;
+    detail::coro::coroutine_handle<> handle_;
+
+    static void resume_all(awaiter *head) {
+      /* the list is pushed to at the front; restore suspension order */
+      awaiter *fifo = nullptr;
+      while (head) {
+        awaiter *next = head->next_;
+        head->next_ = fifo;
+        fifo = head;
+        head = next;
+      }
+      /* a resumed coroutine may destroy its frame and with it the node */
+      while (fifo) {
+        awaiter *next = fifo->next_;
+        fifo->handle_.resume();
+        fifo = next;
+      }
+    }
+
+  public:
+    explicit awaiter(job &j) noexcept : job_(j) {}
+
+    bool await_ready() const { return job_.ready(); }
+    bool await_suspend(detail::coro::coroutine_handle<> h) noexcept {
+      handle_ = h;
+      void *head = job_.state_.load();
+      do {
+        /* completed between await_ready() and here: do not suspend */
+        if (head == &job_)
+          return false;
+        next_ = static_cast<awaiter *>(head);
+      } while (!job_.state_.compare_exchange_weak(head, this));
+      return true;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  awaiter operator co_await() noexcept { return awaiter(*this); }
+#endif
+};
+
+/* Job with a callable body stored in place. */
+template <typename Func> class task : public job {
+  Func func_;
+
+  static void invoke(void *context) { (*static_cast<Func *>(context))(); }
+
+public:
+  template <typename F>
+  task(const uint64_t id, F &&func)
+      : job(id, &task::invoke, &func_), func_(std::forward<F>(func)) {}
+};
+
+template <typename Func>
+task<std::decay_t<Func>> make_task(const uint64_t id, Func &&func) {
+  return {id, std::forward<Func>(func)};
+}
+
+#ifdef ATLAS_HAVE_COROUTINES
+/* Caller-provided storage for the frame of one atlas::detached coroutine at a
+ * time. It is released again when the coroutine runs to completion. */
+class frame_base {
+  unsigned char *const buffer_;
+  const size_t size_;
+  /* released on whichever thread the coroutine finishes on */
+  std::atomic_bool used_{false};
+
+  /* the owning frame is stored in front of the coroutine frame, so that
+   * release() gets by with the pointer operator delete is handed */
+  static constexpr size_t header = alignof(std::max_align_t);
+  static_assert(sizeof(frame_base *) <= header, "Frame header too small.");
+
+protected:
+  frame_base(unsigned char *buffer, const size_t size) noexcept
+      : buffer_(buffer), size_(size) {}
+
+public:
+  frame_base(const frame_base &) = delete;
+  frame_base &operator=(const frame_base &) = delete;
+
+  void *allocate(const size_t size) {
+    if (size_ < header || size > size_ - header || used_.exchange(true))
+      throw std::bad_alloc();
+    frame_base *self = this;
+    std::copy(reinterpret_cast<unsigned char *>(&self),
+              reinterpret_cast<unsigned char *>(&self + 1), buffer_);
+    return buffer_ + header;
+  }
+
+  static void release(void *ptr) noexcept {
+    frame_base *self;
+    unsigned char *src = static_cast<unsigned char *>(ptr) - header;
+    std::copy(src, src + sizeof(self), reinterpret_cast<unsigned char *>(&self));
+    self->used_.store(false);
+  }
+};
+
+template <size_t Size> class frame : public frame_base {
+  static_assert(Size > alignof(std::max_align_t),
+                "Frame must be larger than its header.");
+  alignas(std::max_align_t) unsigned char storage_[Size];
+
+public:
+  frame() noexcept : frame_base(storage_, Size) {}
+};
+
+/* Return type of fire-and-forget coroutines, e.g. ones co_await-ing jobs.
+ * The coroutine starts running immediately and its frame is placed in the
+ * atlas::frame passed as first argument (second for member functions and
+ * lambdas), so it never allocates; std::bad_alloc is thrown if the frame is
+ * in use or too small. Exceptions escaping the coroutine terminate. */
+struct detached {
+  struct promise_type {
+    template <typename... Args>
+    static void *operator new(size_t size, frame_base &frame, Args &...) {
+      return frame.allocate(size);
+    }
+
+    template <typename Object, typename... Args>
+    static void *operator new(size_t size, Object &, frame_base &frame,
+                              Args &...) {
+      return frame.allocate(size);
+    }
+
+    static void operator delete(void *ptr) noexcept {
+      frame_base::release(ptr);
+    }
+
+    detached get_return_object() noexcept { return {}; }
+    detail::coro::suspend_never initial_suspend() noexcept { return {}; }
+    detail::coro::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+#endif
+
+/* Dispatches jobs to the consumer thread it was created for. Producers call
+ * submit(), the consumer calls run_one() in place of atlas::next(); jobs are
+ * completed in the order the kernel returns their ids. */
+class executor {
+  const pid_t tid_;
+  std::mutex mutex_;
+  job *pending_ = nullptr;
+
+  void link(job &j) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    j.next_ = pending_;
+    pending_ = &j;
+  }
+
+  bool unlink(job &j) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (job **it = &pending_; *it; it = &(*it)->next_) {
+      if (*it == &j) {
+        *it = j.next_;
+        j.next_ = nullptr;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  job *unlink(const uint64_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (job **it = &pending_; *it; it = &(*it)->next_) {
+      if ((*it)->id_ == id) {
+        job *j = *it;
+        *it = j->next_;
+        j->next_ = nullptr;
+        return j;
+      }
+    }
+    return nullptr;
+  }
+
+public:
+  explicit executor(const pid_t tid) noexcept : tid_(tid) {}
+
+  template <typename Handle>
+  explicit executor(const Handle &handle) : tid_(np::from(handle)) {}
+
+  executor(const executor &) = delete;
+  executor &operator=(const executor &) = delete;
+
+  pid_t tid() const noexcept { return tid_; }
+
+  /* The job is registered before the syscall, so the consumer cannot be
+   * handed its id before it can be found. On failure it is removed again and
+   * errno is left as set by the kernel. A job can be submitted only once;
+   * submitting it again, even after it completed, fails with EBUSY. */
+  template <class Rep, class Period, typename Deadline>
+  long submit(job &j, std::chrono::duration<Rep, Period> exec_time,
+              Deadline deadline) {
+    if (j.submitted_.exchange(true)) {
+      errno = EBUSY;
+      return -1;
+    }
+
+    link(j);
+    auto ret = atlas::submit(tid_, j.id(), exec_time, deadline);
+    if (ret) {
+      const int error = errno;
+      unlink(j);
+      j.submitted_ = false;
+      errno = error;
+    }
+    return ret;
+  }
+
+  /* Withdraws a job submitted through this executor. Only if the kernel
+   * still had it queued is it completed as cancelled; otherwise the consumer
+   * has already been handed its id and completes it as usual. Use this rather
+   * than atlas::remove(), which would leave the job pending forever. Returns
+   * the result of atlas::remove(). */
+  long remove(job &j) {
+    auto ret = atlas::remove(tid_, j.id());
+    if (ret)
+      return ret;
+
+    if (unlink(j))
+      j.complete(true);
+    return ret;
+  }
+
+  /* Blocks in atlas::next() and completes the job with the returned id. Ids
+   * not submitted through this executor are passed over. If the job's body
+   * throws, the job is completed as cancelled and the exception propagates.
+   * Returns the result of atlas::next(). */
+  long run_one() {
+    uint64_t id;
+    auto ret = atlas::next(id);
+    if (ret)
+      return ret;
+
+    if (job *j = unlink(id)) {
+      try {
+        if (j->body_)
+          j->body_(j->context_);
+      } catch (...) {
+        j->complete(true);
+        throw;
+      }
+      j->complete();
+    }
+    return ret;
+  }
+};
 }
 
 #endif /* __cplusplus */
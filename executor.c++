@@ -0,0 +1,261 @@
+#include <chrono>
+#include <thread>
+#include <future>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <exception>
+
+#include <cerrno>
+
+#include <boost/program_options.hpp>
+
+#include "atlas.h"
+#include "common.h"
+
+struct record {
+  uint64_t id;
+  std::thread::id thread;
+  bool ready;
+};
+
+static void consume(std::future<atlas::executor *> handoff, int pinned_to,
+                    size_t num) {
+  if (pinned_to >= 0)
+    set_affinity(static_cast<unsigned>(pinned_to));
+  atlas::executor &executor = *handoff.get();
+  for (size_t i = 0; i < num; ++i) {
+    check_zero(executor.run_one());
+  }
+}
+
+static bool check(const std::vector<record> &log, const size_t num,
+                  const size_t waiters, const std::thread::id consumer) {
+  if (log.size() != num * waiters) {
+    std::cerr << log.size() << " of " << num * waiters << " jobs completed"
+              << std::endl;
+    return false;
+  }
+
+  for (size_t i = 0; i < log.size(); ++i) {
+    const auto &entry = log.at(i);
+    if (entry.id != i / waiters) {
+      std::cerr << "Job " << entry.id << " completed at position " << i
+                << std::endl;
+      return false;
+    }
+    if (entry.thread != consumer) {
+      std::cerr << "Job " << entry.id << " completed off the consumer thread"
+                << std::endl;
+      return false;
+    }
+    if (!entry.ready) {
+      std::cerr << "Job " << entry.id << " resumed before completion"
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* jobs are submitted in order of increasing deadline and block the producer
+ * until all of them completed */
+static bool blocking(int pinned_to, size_t num) {
+  using namespace std::chrono;
+  std::promise<atlas::executor *> handoff;
+  std::thread consumer(consume, handoff.get_future(), pinned_to, num);
+  atlas::executor executor(consumer);
+  handoff.set_value(&executor);
+
+  std::vector<record> log;
+  log.reserve(num);
+
+  using task = atlas::task<std::function<void()>>;
+  std::vector<std::unique_ptr<task>> jobs;
+  jobs.reserve(num);
+  for (size_t i = 0; i < num; ++i) {
+    jobs.emplace_back(std::make_unique<task>(
+        i, [&log, i] { log.push_back({i, std::this_thread::get_id(), true}); }));
+    check_zero(executor.submit(*jobs.back(), 50ms, 10s + i * 1s));
+  }
+
+  for (const auto &job : jobs)
+    job->wait();
+
+  const auto consumer_id = consumer.get_id();
+  consumer.join();
+
+  return check(log, num, 1, consumer_id);
+}
+
+#ifdef ATLAS_HAVE_COROUTINES
+static atlas::detached resume_after(atlas::frame_base &, atlas::job &job,
+                                    std::vector<record> &log) {
+  co_await job;
+  log.push_back({job.id(), std::this_thread::get_id(),
+                 job.ready() && !job.cancelled()});
+}
+
+/* every job is awaited by several coroutines before it is submitted; jobs are
+ * submitted in order of decreasing deadline, so completion order is only right
+ * if coroutines are resumed in the order atlas::next() returns ids */
+static bool coroutines(int pinned_to, size_t num) {
+  using namespace std::chrono;
+  const size_t waiters = 2;
+  std::promise<atlas::executor *> handoff;
+  std::thread consumer(consume, handoff.get_future(), pinned_to, num);
+  atlas::executor executor(consumer);
+
+  std::vector<record> log;
+  log.reserve(num * waiters);
+
+  auto frames = std::make_unique<atlas::frame<1024>[]>(num * waiters);
+  std::vector<std::unique_ptr<atlas::job>> jobs;
+  jobs.reserve(num);
+  for (size_t i = 0; i < num; ++i) {
+    jobs.emplace_back(std::make_unique<atlas::job>(i));
+    for (size_t waiter = 0; waiter < waiters; ++waiter)
+      resume_after(frames[i * waiters + waiter], *jobs.back(), log);
+  }
+
+  for (size_t i = num; i-- > 0;) {
+    check_zero(executor.submit(*jobs.at(i), 50ms, 10s + i * 1s));
+  }
+  /* the consumer only enters atlas::next() once all jobs are queued */
+  handoff.set_value(&executor);
+
+  const auto consumer_id = consumer.get_id();
+  consumer.join();
+
+  return check(log, num, waiters, consumer_id);
+}
+
+static void expect(const bool condition, const char *msg) {
+  if (!condition) {
+    std::cerr << msg << std::endl;
+    std::terminate();
+  }
+}
+
+static atlas::detached resume_cancelled(atlas::frame_base &, atlas::job &job,
+                                        std::vector<record> &log) {
+  co_await job;
+  log.push_back({job.id(), std::this_thread::get_id(), job.cancelled()});
+}
+
+/* a task awaited by two coroutines is removed before the consumer gets to it;
+ * it must not run, both coroutines must be resumed by remove() and the
+ * remaining jobs still complete in deadline order */
+static bool cancellation(int pinned_to, size_t num) {
+  using namespace std::chrono;
+  const size_t waiters = 2;
+  std::promise<atlas::executor *> handoff;
+  std::thread consumer(consume, handoff.get_future(), pinned_to, num);
+  atlas::executor executor(consumer);
+
+  std::vector<record> log;
+  log.reserve(num * waiters);
+  std::vector<record> cancelled;
+  cancelled.reserve(waiters);
+
+  bool ran = false;
+  auto victim = atlas::make_task(num, [&ran] { ran = true; });
+  auto frames = std::make_unique<atlas::frame<1024>[]>((num + 1) * waiters);
+  for (size_t waiter = 0; waiter < waiters; ++waiter)
+    resume_cancelled(frames[num * waiters + waiter], victim, cancelled);
+
+  try {
+    resume_cancelled(frames[num * waiters], victim, cancelled);
+    expect(false, "Frame in use was handed out again");
+  } catch (const std::bad_alloc &) {
+  }
+
+  try {
+    atlas::frame<64> small;
+    resume_cancelled(small, victim, cancelled);
+    expect(false, "Coroutine frame fit into 64 bytes");
+  } catch (const std::bad_alloc &) {
+  }
+
+  std::vector<std::unique_ptr<atlas::job>> jobs;
+  jobs.reserve(num);
+  for (size_t i = 0; i < num; ++i) {
+    jobs.emplace_back(std::make_unique<atlas::job>(i));
+    for (size_t waiter = 0; waiter < waiters; ++waiter)
+      resume_after(frames[i * waiters + waiter], *jobs.back(), log);
+  }
+
+  for (size_t i = num; i-- > 0;) {
+    check_zero(executor.submit(*jobs.at(i), 50ms, 10s + i * 1s));
+  }
+  check_zero(executor.submit(victim, 50ms, 10s + num / 2 * 1s));
+
+  expect(executor.submit(victim, 50ms, 10s) == -1 && errno == EBUSY,
+         "Pending job was submitted twice");
+
+  check_zero(executor.remove(victim));
+
+  expect(victim.ready() && victim.cancelled() && !ran,
+         "Removed job did not complete as cancelled");
+  expect(executor.submit(victim, 50ms, 10s) == -1 && errno == EBUSY,
+         "Cancelled job was submitted again");
+  expect(cancelled.size() == waiters,
+         "Not all coroutines of the removed job were resumed");
+  for (const auto &entry : cancelled) {
+    expect(entry.thread == std::this_thread::get_id() && entry.ready,
+           "Coroutine of removed job resumed off remove() or uncancelled");
+  }
+
+  handoff.set_value(&executor);
+
+  const auto consumer_id = consumer.get_id();
+  consumer.join();
+
+  return check(log, num, waiters, consumer_id);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  int pinned_to;
+  size_t num;
+
+  namespace po = boost::program_options;
+  po::options_description desc("Test job completion through atlas::executor");
+  desc.add_options()
+    ("help", "produce help message")
+    ("pin", po::value(&pinned_to)->default_value(-1) ,
+      "Whether to pin the worker thread and if so to which CPU. "
+      "(default: unpinned)")
+    ("jobs", po::value(&num)->default_value(100),
+      "Number of jobs to submit (default: 100)");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!blocking(pinned_to, num))
+    return EXIT_FAILURE;
+  std::cout << num << " blocking jobs completed in deadline order"
+            << std::endl;
+
+#ifdef ATLAS_HAVE_COROUTINES
+  if (!coroutines(pinned_to, num))
+    return EXIT_FAILURE;
+  std::cout << num << " awaited jobs completed in deadline order" << std::endl;
+
+  if (!cancellation(pinned_to, num))
+    return EXIT_FAILURE;
+  std::cout << "Removed job cancelled, " << num
+            << " awaited jobs completed in deadline order" << std::endl;
+#else
+  std::cout << "Coroutine support not available" << std::endl;
+#endif
+}